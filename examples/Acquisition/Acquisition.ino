@@ -0,0 +1,104 @@
+/*
+   PAA3905 optical flow sensor dedicated-task acquisition example (ESP32)
+
+   Copyright (c) 2021 Tlera Corporiation and Simon D. Levy
+
+   MIT License
+ */
+
+#include <SPI.h>
+
+#include "PAA3905_Acquisition.hpp"
+#include "Debugger.hpp"
+
+// Set to 0 for periodic acquisition at PERIOD_USEC
+static const uint8_t MOT_PIN = 23; 
+
+static const uint32_t PERIOD_USEC = 10000;
+
+static const uint32_t REPORT_PERIOD_MSEC = 1000;
+
+PAA3905_MotionCapture _sensor(
+        PAA3905::DETECTION_STANDARD,
+        PAA3905::AUTO_MODE_01,
+        PAA3905::ORIENTATION_NORMAL,
+        0x2A); // resolution 0x00 to 0xFF
+
+static PAA3905_MotionSource _source(_sensor);
+
+// Run acquisition on core 0, leaving core 1 to the Arduino loop().  The task
+// blocks between reads, so it shares core 0 with WiFi/BT and IDLE0.
+static PAA3905_FreeRtosScheduler _scheduler(0);
+
+static PAA3905_Acquisition<PAA3905_MotionSource> _acquisition(
+        _source, _scheduler, MOT_PIN ? 0 : PERIOD_USEC);
+
+void IRAM_ATTR motionInterruptHandler()
+{
+    _acquisition.notifyFromIsr();
+}
+
+void setup() 
+{
+    Serial.begin(115200);
+
+    // Start SPI
+    SPI.begin();
+
+    delay(100);
+
+    // Check device ID as a test of SPI communications
+    if (!_sensor.begin()) {
+        Debugger::reportForever("PAA3905 initialization failed");
+    }
+
+    if (!_acquisition.begin()) {
+        Debugger::reportForever("Unable to start acquisition task");
+    }
+
+    if (MOT_PIN) {
+        pinMode(MOT_PIN, INPUT); 
+        attachInterrupt(MOT_PIN, motionInterruptHandler, FALLING);
+    }
+} 
+
+void loop()
+{
+    static int32_t _x, _y;
+
+    static PAA3905_Acquisition<PAA3905_MotionSource>::record_t record;
+
+    if (_acquisition.fetch(record)) {
+
+        const PAA3905_MotionSource::sample_t & sample = record.sample;
+
+        if (_sensor.dataAboveThresholds(
+                    sample.lightMode, sample.surfaceQuality, sample.shutter)) {
+            _x += sample.deltaX;
+            _y += sample.deltaY;
+        }
+    }
+
+    static uint32_t _lastReportMsec;
+
+    uint32_t msec = millis();
+
+    if (msec - _lastReportMsec > REPORT_PERIOD_MSEC) {
+
+        _lastReportMsec = msec;
+
+        PAA3905_Acquisition<PAA3905_MotionSource>::stats_t stats;
+
+        _acquisition.getStats(stats);
+
+        Debugger::printf("X: %+06d  Y: %+06d  seq: %d\n", _x, _y, record.sequence);
+        Debugger::printf("cycles: %d  dropped: %d  deadline misses: %d  "
+                "timeouts: %d\n", stats.cycles, stats.dropped,
+                stats.deadlineMisses, stats.timeouts);
+        Debugger::printf("jitter: last %+d  min %+d  max %+d  mean %+0.1f usec  "
+                "max acquire: %d usec\n\n",
+                stats.jitterLastUsec, stats.jitterMinUsec, stats.jitterMaxUsec,
+                stats.jitterMeanUsec, stats.acquireMaxUsec);
+    }
+
+} // loop
@@ -17,6 +17,12 @@ static const uint8_t RESOLUTION = 0x2A;
 
 PAA3905_FrameCapture _sensor(PAA3905::ORIENTATION_NORMAL, RESOLUTION);
 
+// Rotate 180 degrees during readout so that display.py can show frames as-is.
+// With dark/flat calibration, corrected pixels can reach 0xFF, which is the
+// frame sentinel below, so they are clamped to 0xFE when sent.
+static PAA3905_Calibration _calibration(
+        PAA3905::ORIENTATION_XINVERT | PAA3905::ORIENTATION_YINVERT);
+
 void setup() 
 {
     Serial.begin(115200);
@@ -42,13 +48,15 @@ void loop()
 
         static uint8_t frameArray[1225];
 
-        _sensor.captureFrame(frameArray);
+        _sensor.captureFrame(frameArray, _calibration);
 
         for (uint8_t j = 0; j < 35; j++) {
 
             for (uint8_t k = 0; k < 35; k++) {
 
-                Serial.write(frameArray[j*35 + k]);
+                const uint8_t pixel = frameArray[j*35 + k];
+
+                Serial.write(pixel < 0xFF ? pixel : 0xFE);
             }
         }
 
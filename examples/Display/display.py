@@ -56,5 +56,5 @@ while True:
 
     else:
 
-        image[35 - (count // 35) - 1, 35 - (count % 35) - 1] = b
+        image[count // 35, count % 35] = b
         count += 1
@@ -0,0 +1,234 @@
+/*
+   Host-side check of PAA3905_Acquisition on the std::thread scheduler
+
+   Usage: acquisition_test
+
+   Exits nonzero if any check fails.
+
+   Copyright (c) 2021 Tlera Corporation and Simon D. Levy
+
+   MIT License
+ */
+
+#include <stdio.h>
+
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "PAA3905_Acquisition.hpp"
+
+static uint32_t _failures;
+
+#define CHECK(cond) check((cond), #cond, __LINE__)
+
+static void check(const bool ok, const char * what, const int line)
+{
+    if (!ok) {
+        printf("  FAILED line %d: %s\n", line, what);
+        _failures++;
+    }
+}
+
+static void sleepMsec(const uint32_t msec)
+{
+    std::this_thread::sleep_for(std::chrono::milliseconds(msec));
+}
+
+// Stands in for the sensor: each sample is a running count of reads
+class FakeSource {
+
+    public:
+
+        typedef struct {
+            uint32_t value;
+        } sample_t;
+
+        std::atomic<uint32_t> reads;
+
+        FakeSource(void)
+        {
+            reads = 0;
+        }
+
+        bool acquire(sample_t & sample)
+        {
+            sample.value = reads++;
+            return true;
+        }
+
+}; // class FakeSource
+
+typedef PAA3905_Acquisition<FakeSource, PAA3905_ThreadScheduler> acquisition_t;
+
+static void testMailbox(void)
+{
+    printf("mailbox\n");
+
+    PAA3905_Mailbox<int> mailbox;
+    int value = 0;
+
+    CHECK(!mailbox.fetch(value));
+
+    CHECK(mailbox.publish(1));
+    CHECK(mailbox.fetch(value) && value == 1);
+    CHECK(!mailbox.fetch(value));
+
+    // Unread values are overwritten, and the overwrite is reported
+    CHECK(mailbox.publish(2));
+    CHECK(!mailbox.publish(3));
+    CHECK(mailbox.fetch(value) && value == 3);
+    CHECK(!mailbox.fetch(value));
+}
+
+static void testPeriodic(void)
+{
+    printf("periodic\n");
+
+    FakeSource source;
+    PAA3905_ThreadScheduler scheduler;
+    acquisition_t acquisition(source, scheduler, 2000);
+
+    CHECK(acquisition.begin());
+    CHECK(!acquisition.begin());
+
+    acquisition_t::record_t record;
+    uint32_t fetched = 0;
+    uint32_t lastSequence = 0;
+    bool ordered = true;
+
+    for (uint32_t k = 0; k < 50; ++k) {
+        sleepMsec(5);
+        if (acquisition.fetch(record)) {
+            ordered &= fetched == 0 || record.sequence > lastSequence;
+            ordered &= record.sample.value == record.sequence;
+            lastSequence = record.sequence;
+            fetched++;
+        }
+    }
+
+    acquisition.end();
+
+    acquisition_t::stats_t stats;
+    acquisition.getStats(stats);
+
+    // Roughly 250 msec at 2 msec, allowing for a loaded machine
+    CHECK(stats.cycles >= 20);
+    CHECK(stats.published == source.reads);
+    CHECK(fetched > 0 && ordered);
+    CHECK(lastSequence < stats.published);
+
+    // Everything published was either fetched, overwritten, or still waiting
+    CHECK(stats.dropped + fetched <= stats.published);
+    CHECK(stats.dropped + fetched + 1 >= stats.published);
+
+    CHECK(stats.timeouts == 0);
+    CHECK(stats.jitterMinUsec <= stats.jitterMaxUsec);
+
+    // Nothing runs after end()
+    const uint32_t reads = source.reads;
+    sleepMsec(10);
+    CHECK(source.reads == reads);
+}
+
+static void testInterrupt(void)
+{
+    printf("interrupt\n");
+
+    FakeSource source;
+    PAA3905_ThreadScheduler scheduler;
+    acquisition_t acquisition(source, scheduler, 0, 0, 1000000);
+
+    CHECK(acquisition.begin());
+
+    for (uint32_t k = 0; k < 10; ++k) {
+        acquisition.notifyFromIsr();
+        sleepMsec(5);
+    }
+
+    acquisition_t::record_t record;
+    CHECK(acquisition.fetch(record) && record.sequence == 9);
+
+    acquisition.end();
+
+    acquisition_t::stats_t stats;
+    acquisition.getStats(stats);
+
+    CHECK(stats.cycles == 10);
+    CHECK(stats.published == 10);
+    CHECK(stats.timeouts == 0);
+    CHECK(stats.jitterMinUsec >= 0);
+}
+
+static void testTimeout(void)
+{
+    printf("timeout\n");
+
+    FakeSource source;
+    PAA3905_ThreadScheduler scheduler;
+    acquisition_t acquisition(source, scheduler, 0, 0, 10000);
+
+    // No interrupts at all: the timeout must still read the sensor
+    CHECK(acquisition.begin());
+    sleepMsec(55);
+    acquisition.end();
+
+    acquisition_t::stats_t stats;
+    acquisition.getStats(stats);
+
+    CHECK(stats.timeouts >= 2);
+    CHECK(stats.timeouts == stats.cycles);
+    CHECK(source.reads == stats.cycles);
+}
+
+static void testRestart(void)
+{
+    printf("restart\n");
+
+    FakeSource source;
+    PAA3905_ThreadScheduler scheduler;
+
+    // end() of a periodic run leaves a wakeup pending on the scheduler...
+    {
+        acquisition_t periodic(source, scheduler, 1000);
+        CHECK(periodic.begin());
+        sleepMsec(10);
+        periodic.end();
+    }
+
+    // ...which must not turn into a spurious cycle in interrupt mode
+    acquisition_t interrupt(source, scheduler, 0, 0, 1000000);
+    const uint32_t reads = source.reads;
+
+    CHECK(interrupt.begin());
+    sleepMsec(20);
+
+    acquisition_t::stats_t stats;
+    interrupt.getStats(stats);
+    CHECK(stats.cycles == 0 && source.reads == reads);
+
+    interrupt.notifyFromIsr();
+    sleepMsec(10);
+    interrupt.end();
+
+    interrupt.getStats(stats);
+    CHECK(stats.cycles == 1);
+
+    // end() is idempotent and the object can be started again
+    interrupt.end();
+    CHECK(interrupt.begin());
+    interrupt.end();
+}
+
+int main(void)
+{
+    testMailbox();
+    testPeriodic();
+    testInterrupt();
+    testTimeout();
+    testRestart();
+
+    printf(_failures ? "%u check(s) failed\n" : "all checks passed\n", _failures);
+
+    return _failures ? 1 : 0;
+}
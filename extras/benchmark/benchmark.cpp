@@ -0,0 +1,260 @@
+/*
+   Throughput benchmark for PAA3905_FramePipeline
+
+   Usage: benchmark [RECORDING [MOTION CPI_PER_METER]]
+
+   RECORDING is a raw capture of the Display example's serial stream (35x35
+   pixel bytes followed by a 0xFF sentinel), e.g.
+
+       cat /dev/ttyACM0 > recording.bin
+
+   MOTION is a text file with one "deltaX deltaY" line per frame, the sensor's
+   motion counts summed over each frame interval, and CPI_PER_METER is what
+   PAA3905::getResolution() reported.  Without it, the deltas for the
+   registration-supplied runs come from a first pass of the estimator.
+
+   Without a recording, a synthetic sequence of a drifting noisy texture is
+   generated, for which the true motion deltas are known.
+
+   Copyright (c) 2021 Tlera Corporation and Simon D. Levy
+
+   MIT License
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "PAA3905_FramePipeline.hpp"
+
+static const uint16_t PIXELS = PAA3905_FramePipeline::PIXELS;
+
+static const uint32_t SYNTHETIC_FRAMES = 500;
+
+static const uint32_t MIN_FRAMES = 2000;
+
+typedef struct {
+    std::vector<uint8_t> pixels;
+    std::vector<float>   dx;
+    std::vector<float>   dy;
+    uint32_t count;
+} sequence_t;
+
+static bool load(const char * filename, sequence_t & seq)
+{
+    FILE * fp = fopen(filename, "rb");
+
+    if (!fp) {
+        return false;
+    }
+
+    uint8_t frame[PIXELS];
+    uint16_t n = 0;
+    int c;
+
+    seq.count = 0;
+
+    while ((c = fgetc(fp)) != EOF) {
+
+        if (c == 0xFF) {
+            // Partial frames occur at the start of a capture; skip them
+            if (n == PIXELS) {
+                seq.pixels.insert(seq.pixels.end(), frame, frame + PIXELS);
+                seq.count++;
+            }
+            n = 0;
+        }
+        else if (n < PIXELS) {
+            frame[n++] = c;
+        }
+    }
+
+    fclose(fp);
+
+    return seq.count > 0;
+}
+
+static bool loadMotion(const char * filename, const float cpiPerMeter,
+        sequence_t & seq)
+{
+    FILE * fp = fopen(filename, "r");
+
+    if (!fp) {
+        return false;
+    }
+
+    const float pixelsPerCount = PAA3905_FramePipeline::pixelsPerCount(cpiPerMeter);
+
+    seq.dx.resize(seq.count);
+    seq.dy.resize(seq.count);
+
+    uint32_t f = 0;
+    int deltaX, deltaY;
+
+    while (f < seq.count && fscanf(fp, "%d %d", &deltaX, &deltaY) == 2) {
+        PAA3905_FramePipeline::motionToPixels(
+                deltaX, deltaY, pixelsPerCount, seq.dx[f], seq.dy[f]);
+        f++;
+    }
+
+    fclose(fp);
+
+    return f == seq.count;
+}
+
+static void estimateMotion(sequence_t & seq)
+{
+    PAA3905_FramePipeline pipeline(1, 1, 0.5f, 24, 1);
+
+    std::vector<uint8_t> output(PIXELS);
+
+    seq.dx.resize(seq.count);
+    seq.dy.resize(seq.count);
+
+    for (uint32_t f = 0; f < seq.count; ++f) {
+        pipeline.process(&seq.pixels[f * PIXELS], &output[0]);
+        pipeline.getShift(seq.dx[f], seq.dy[f]);
+    }
+}
+
+static void synthesize(sequence_t & seq)
+{
+    static const int TEXTURE = 256;
+
+    std::vector<float> texture(TEXTURE * TEXTURE);
+
+    srand(0);
+
+    for (int k = 0; k < TEXTURE * TEXTURE; ++k) {
+        texture[k] = rand() % 128;
+    }
+
+    // Smooth so that the texture has structure at a few-pixel scale
+    for (int pass = 0; pass < 3; ++pass) {
+        for (int j = 1; j < TEXTURE - 1; ++j) {
+            for (int k = 1; k < TEXTURE - 1; ++k) {
+                float & t = texture[j * TEXTURE + k];
+                t = (t * 4 + texture[j * TEXTURE + k - 1] +
+                        texture[j * TEXTURE + k + 1] +
+                        texture[(j - 1) * TEXTURE + k] +
+                        texture[(j + 1) * TEXTURE + k]) / 8;
+            }
+        }
+    }
+
+    seq.count = SYNTHETIC_FRAMES;
+    seq.pixels.resize(seq.count * PIXELS);
+    seq.dx.resize(seq.count);
+    seq.dy.resize(seq.count);
+
+    float x = 64, y = 64;
+
+    for (uint32_t f = 0; f < seq.count; ++f) {
+
+        seq.dx[f] = f ? 0.7f * cosf(f * 0.05f) : 0;
+        seq.dy[f] = f ? 0.4f * sinf(f * 0.03f) : 0;
+
+        // Scene moving by +d in the image means the view moving by -d
+        x -= seq.dx[f];
+        y -= seq.dy[f];
+
+        for (int j = 0; j < 35; ++j) {
+            for (int k = 0; k < 35; ++k) {
+                const float u = x + k, v = y + j;
+                const int iu = (int)u, iv = (int)v;
+                const float fu = u - iu, fv = v - iv;
+                const float * t = &texture[iv * TEXTURE + iu];
+                const float value = (1 - fv) * ((1 - fu) * t[0] + fu * t[1]) +
+                    fv * ((1 - fu) * t[TEXTURE] + fu * t[TEXTURE + 1]);
+                const int noisy = (int)(value + (rand() % 17) - 8);
+                seq.pixels[f * PIXELS + j * 35 + k] =
+                    noisy < 0 ? 0 : noisy > 0xFE ? 0xFE : noisy;
+            }
+        }
+    }
+}
+
+static void bench(const sequence_t & seq, const uint8_t scale,
+        const unsigned threads, const bool useDeltas)
+{
+    PAA3905_FramePipeline pipeline(scale, 4, 0.5f, 24, threads);
+
+    std::vector<uint8_t> output(pipeline.outputSize() * pipeline.outputSize());
+
+    const uint32_t passes = (MIN_FRAMES + seq.count - 1) / seq.count;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    for (uint32_t pass = 0; pass < passes; ++pass) {
+
+        pipeline.reset();
+
+        for (uint32_t f = 0; f < seq.count; ++f) {
+
+            const uint8_t * frame = &seq.pixels[f * PIXELS];
+
+            if (useDeltas) {
+                pipeline.process(frame, seq.dx[f], seq.dy[f], &output[0]);
+            }
+            else {
+                pipeline.process(frame, &output[0]);
+            }
+        }
+    }
+
+    const double seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+
+    const uint32_t frames = passes * seq.count;
+
+    printf("scale %d  threads %2u  %-9s  %9.1f frames/s  %7.1f usec/frame\n",
+            scale, threads, useDeltas ? "deltas" : "estimated",
+            frames / seconds, 1e6 * seconds / frames);
+}
+
+int main(int argc, char ** argv)
+{
+    sequence_t seq;
+
+    if (argc > 1) {
+
+        if (!load(argv[1], seq)) {
+            fprintf(stderr, "Unable to read frames from %s\n", argv[1]);
+            return 1;
+        }
+
+        if (argc > 3) {
+            if (!loadMotion(argv[2], atof(argv[3]), seq)) {
+                fprintf(stderr, "Need %u motion lines in %s\n", seq.count, argv[2]);
+                return 1;
+            }
+            printf("%s: %u frames, deltas from %s\n\n",
+                    argv[1], seq.count, argv[2]);
+        }
+        else {
+            estimateMotion(seq);
+            printf("%s: %u frames, deltas pre-estimated\n\n", argv[1], seq.count);
+        }
+    }
+    else {
+        synthesize(seq);
+        printf("synthetic: %u frames, true deltas\n\n", seq.count);
+    }
+
+    unsigned cores = std::thread::hardware_concurrency();
+
+    for (uint8_t scale = 2; scale <= PAA3905_FramePipeline::MAX_SCALE; ++scale) {
+
+        for (unsigned threads = 1; threads <= cores; threads *= 2) {
+
+            bench(seq, scale, threads, true);
+            bench(seq, scale, threads, false);
+        }
+    }
+
+    return 0;
+}
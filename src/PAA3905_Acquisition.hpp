@@ -0,0 +1,653 @@
+/* PAA3905 acquisition service
+ *
+ * Runs sensor reads on a dedicated task, either periodically or when
+ * signaled from an interrupt, and publishes the newest result through a
+ * wait-free mailbox.  The scheduler is pluggable: a FreeRTOS backend for
+ * ESP32 and a std::thread backend for host builds.
+ *
+ * Copyright (c) 2021 Tlera Corporation and Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+
+#if defined(ESP32)
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#elif !defined(ARDUINO)
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+#if defined(ARDUINO)
+#include "PAA3905_MotionCapture.hpp"
+#include "PAA3905_FrameCapture.hpp"
+#endif
+
+// Single-producer / single-consumer triple buffer.  Neither side ever
+// blocks or retries: the producer always has a free slot to write into, and
+// the consumer always gets the most recently completed value.
+template <typename T>
+class PAA3905_Mailbox {
+
+    public:
+
+        PAA3905_Mailbox(void)
+            : m_latest(2), m_write(0), m_read(1)
+        {
+        }
+
+        // Returns false if the previous value was never fetched (overwritten)
+        bool publish(const T & value)
+        {
+            m_buffer[m_write] = value;
+            const uint8_t previous = m_latest.exchange(
+                    m_write | FRESH, std::memory_order_acq_rel);
+            m_write = previous & INDEX;
+            return !(previous & FRESH);
+        }
+
+        // Returns false if nothing new has been published since last fetch
+        bool fetch(T & value)
+        {
+            if (!(m_latest.load(std::memory_order_acquire) & FRESH)) {
+                return false;
+            }
+            m_read = m_latest.exchange(m_read, std::memory_order_acq_rel) & INDEX;
+            value = m_buffer[m_read];
+            return true;
+        }
+
+    private:
+
+        static const uint8_t INDEX = 0x03;
+        static const uint8_t FRESH = 0x04;
+
+        T m_buffer[3];
+
+        std::atomic<uint8_t> m_latest;
+
+        uint8_t m_write; // owned by producer
+        uint8_t m_read;  // owned by consumer
+
+}; // class PAA3905_Mailbox
+
+// Marks functions that may run from an interrupt handler while the flash
+// cache is disabled
+#if defined(ESP32)
+#define PAA3905_IRAM IRAM_ATTR
+#else
+#define PAA3905_IRAM
+#endif
+
+// A scheduler backend provides:
+//
+//   typedef void (*task_t)(void * arg);
+//   bool     start(task_t task, void * arg);
+//   void     join(void);          // blocks until the task function returns
+//   uint64_t nowUsec(void);
+//   void     startPeriodic(const uint32_t periodUsec);
+//   uint64_t waitForRelease(void);  // returns the nominal release time
+//   bool     waitForSignal(const uint32_t timeoutUsec);  // false on timeout
+//   void     signal(void);          // from task context
+//   void     signalFromIsr(void);   // from an interrupt handler
+//
+// startPeriodic() and the wait functions are only called from the task.
+// Releases that have already passed are skipped rather than fired back to
+// back.  The scheduler is a template parameter of PAA3905_Acquisition rather
+// than a virtual interface so that the interrupt path never goes through a
+// vtable in flash.
+
+#if defined(ESP32)
+
+class PAA3905_FreeRtosScheduler {
+
+    public:
+
+        typedef void (*task_t)(void * arg);
+
+        // Core 1 is the Arduino loop() core; core 0 also runs WiFi/BT, so pick
+        // the one with less else to do in your application
+        PAA3905_FreeRtosScheduler(
+                const BaseType_t core = 0,
+                const UBaseType_t priority = configMAX_PRIORITIES - 2,
+                const uint32_t stackSize = 4096)
+        {
+            m_core = core;
+            m_priority = priority;
+            m_stackSize = stackSize;
+            m_handle = NULL;
+            m_done = true;
+
+            portMUX_INITIALIZE(&m_lock);
+        }
+
+        bool start(task_t task, void * arg)
+        {
+            m_task = task;
+            m_arg = arg;
+            m_done = false;
+
+            // Signals arriving before the handle is stored are simply lost
+            const bool created = xTaskCreatePinnedToCore(trampoline, "paa3905",
+                    m_stackSize, this, m_priority, (TaskHandle_t *)&m_handle,
+                    m_core) == pdPASS;
+
+            m_done = !created;
+
+            return created;
+        }
+
+        // The task suspends itself when done and is deleted here, so the
+        // handle stays valid for signal() until join() has run
+        void join(void)
+        {
+            while (!m_done) {
+                vTaskDelay(1);
+            }
+
+            portENTER_CRITICAL(&m_lock);
+            TaskHandle_t handle = m_handle;
+            m_handle = NULL;
+            portEXIT_CRITICAL(&m_lock);
+
+            if (handle) {
+                vTaskDelete(handle);
+            }
+        }
+
+        uint64_t PAA3905_IRAM nowUsec(void)
+        {
+            return (uint64_t)esp_timer_get_time();
+        }
+
+        // Periods are rounded to whole ticks (at least one), so the task
+        // always blocks and the core stays available to lower-priority tasks,
+        // including IDLE, which feeds the task watchdog
+        void startPeriodic(const uint32_t periodUsec)
+        {
+            m_periodTicks = (periodUsec + TICK_USEC / 2) / TICK_USEC;
+
+            if (m_periodTicks == 0) {
+                m_periodTicks = 1;
+            }
+
+            // Start on a tick boundary so that releases line up with wakeups
+            vTaskDelay(1);
+            m_lastWake = xTaskGetTickCount();
+            m_lastWakeUsec = nowUsec();
+        }
+
+        uint64_t waitForRelease(void)
+        {
+            const TickType_t now = xTaskGetTickCount();
+
+            while ((TickType_t)(now - m_lastWake) >= m_periodTicks) {
+                m_lastWake += m_periodTicks;
+                m_lastWakeUsec += (uint64_t)m_periodTicks * TICK_USEC;
+            }
+
+            vTaskDelayUntil(&m_lastWake, m_periodTicks);
+            m_lastWakeUsec += (uint64_t)m_periodTicks * TICK_USEC;
+
+            return m_lastWakeUsec;
+        }
+
+        bool waitForSignal(const uint32_t timeoutUsec)
+        {
+            return ulTaskNotifyTake(pdTRUE, timeoutUsec / TICK_USEC + 1) > 0;
+        }
+
+        void signal(void)
+        {
+            if (m_handle) {
+                xTaskNotifyGive(m_handle);
+            }
+        }
+
+        void PAA3905_IRAM signalFromIsr(void)
+        {
+            BaseType_t woken = pdFALSE;
+
+            // The lock keeps join() from deleting the task under us
+            portENTER_CRITICAL_ISR(&m_lock);
+            if (m_handle) {
+                vTaskNotifyGiveFromISR(m_handle, &woken);
+            }
+            portEXIT_CRITICAL_ISR(&m_lock);
+
+            if (woken) {
+                portYIELD_FROM_ISR();
+            }
+        }
+
+    private:
+
+        static const uint32_t TICK_USEC = 1000 * portTICK_PERIOD_MS;
+
+        BaseType_t   m_core;
+        UBaseType_t  m_priority;
+        uint32_t     m_stackSize;
+        portMUX_TYPE m_lock;
+        task_t       m_task;
+        void *       m_arg;
+        TickType_t   m_periodTicks;
+        TickType_t   m_lastWake;
+        uint64_t     m_lastWakeUsec;
+
+        volatile TaskHandle_t m_handle;
+        volatile bool         m_done;
+
+        static void trampoline(void * arg)
+        {
+            PAA3905_FreeRtosScheduler * self = (PAA3905_FreeRtosScheduler *)arg;
+
+            self->m_task(self->m_arg);
+
+            self->m_done = true;
+            vTaskSuspend(NULL);
+        }
+
+}; // class PAA3905_FreeRtosScheduler
+
+typedef PAA3905_FreeRtosScheduler PAA3905_DefaultScheduler;
+
+#elif !defined(ARDUINO)
+
+class PAA3905_ThreadScheduler {
+
+    public:
+
+        typedef void (*task_t)(void * arg);
+
+        PAA3905_ThreadScheduler(void)
+        {
+            m_pending = 0;
+            m_periodUsec = 0;
+            m_release = 0;
+        }
+
+        bool start(task_t task, void * arg)
+        {
+            // Drop any wakeup left over from a previous run's end()
+            m_pending = 0;
+
+            m_thread = std::thread(task, arg);
+            return true;
+        }
+
+        void join(void)
+        {
+            if (m_thread.joinable()) {
+                m_thread.join();
+            }
+        }
+
+        uint64_t nowUsec(void)
+        {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                    clock_t::now().time_since_epoch()).count();
+        }
+
+        void startPeriodic(const uint32_t periodUsec)
+        {
+            m_periodUsec = periodUsec;
+            m_release = nowUsec();
+        }
+
+        uint64_t waitForRelease(void)
+        {
+            const uint64_t now = nowUsec();
+
+            m_release += m_periodUsec;
+
+            while (m_release < now) {
+                m_release += m_periodUsec;
+            }
+
+            std::this_thread::sleep_until(
+                    clock_t::time_point(std::chrono::microseconds(m_release)));
+
+            return m_release;
+        }
+
+        bool waitForSignal(const uint32_t timeoutUsec)
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            if (!m_signal.wait_for(lock, std::chrono::microseconds(timeoutUsec),
+                        [this] { return m_pending > 0; })) {
+                return false;
+            }
+
+            m_pending = 0;
+            return true;
+        }
+
+        void signal(void)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_pending++;
+            }
+            m_signal.notify_one();
+        }
+
+        // On the host there are no real interrupts; any thread may call this
+        void signalFromIsr(void)
+        {
+            signal();
+        }
+
+    private:
+
+        typedef std::chrono::steady_clock clock_t;
+
+        std::thread             m_thread;
+        std::mutex              m_mutex;
+        std::condition_variable m_signal;
+        uint32_t                m_pending;
+        uint32_t                m_periodUsec;
+        uint64_t                m_release;
+
+}; // class PAA3905_ThreadScheduler
+
+typedef PAA3905_ThreadScheduler PAA3905_DefaultScheduler;
+
+#else
+
+#error "PAA3905_Acquisition.hpp supports ESP32 (FreeRTOS) on Arduino, or host builds with std::thread"
+
+#endif
+
+// Source must provide a sample_t type and bool acquire(sample_t &), returning
+// false when there is nothing worth publishing.
+template <typename Source, typename Scheduler = PAA3905_DefaultScheduler>
+class PAA3905_Acquisition {
+
+    public:
+
+        typedef typename Source::sample_t sample_t;
+
+        typedef struct {
+            sample_t sample;
+            uint64_t usec;
+            uint32_t sequence;
+        } record_t;
+
+        // Jitter is the signed lateness of each wakeup relative to its
+        // release (or interrupt); negative values are early wakeups
+        typedef struct {
+            uint32_t cycles;
+            uint32_t published;
+            uint32_t dropped;         // published but overwritten unread
+            uint32_t deadlineMisses;  // acquisition finished past its deadline
+            uint32_t timeouts;        // interrupt-mode reads with no interrupt
+            int32_t  jitterLastUsec;
+            int32_t  jitterMinUsec;
+            int32_t  jitterMaxUsec;
+            float    jitterMeanUsec;
+            uint32_t acquireMaxUsec;
+        } stats_t;
+
+        // A periodUsec of 0 selects interrupt-driven mode; call notifyFromIsr()
+        // from the sensor's motion interrupt handler.  If no interrupt arrives
+        // for signalTimeoutUsec the sensor is read anyway, which clears a
+        // motion interrupt whose edge was missed.  The deadline defaults to
+        // the period (or 1 msec in interrupt-driven mode).
+        PAA3905_Acquisition(
+                Source & source,
+                Scheduler & scheduler,
+                const uint32_t periodUsec,
+                const uint32_t deadlineUsec = 0,
+                const uint32_t signalTimeoutUsec = 100000)
+            : m_source(source), m_scheduler(scheduler)
+        {
+            m_periodUsec = periodUsec;
+            m_signalTimeoutUsec = signalTimeoutUsec;
+            m_deadlineUsec = deadlineUsec ? deadlineUsec :
+                periodUsec ? periodUsec : 1000;
+            m_running = false;
+            m_signalUsec = 0;
+        }
+
+        bool begin(void)
+        {
+            if (m_running) {
+                return false;
+            }
+
+            m_running = true;
+
+            if (!m_scheduler.start(task, this)) {
+                m_running = false;
+                return false;
+            }
+
+            return true;
+        }
+
+        void end(void)
+        {
+            if (m_running.exchange(false)) {
+                m_scheduler.signal();
+                m_scheduler.join();
+            }
+        }
+
+        bool fetch(record_t & record)
+        {
+            return m_records.fetch(record);
+        }
+
+        // Returns the most recent snapshot; never blocks the acquisition task
+        void getStats(stats_t & stats)
+        {
+            m_stats.fetch(m_lastStats);
+            stats = m_lastStats;
+        }
+
+        void PAA3905_IRAM notifyFromIsr(void)
+        {
+            // Low 32 bits only: 64-bit atomics are not lock-free on ESP32
+            m_signalUsec.store((uint32_t)m_scheduler.nowUsec(),
+                    std::memory_order_relaxed);
+            m_scheduler.signalFromIsr();
+        }
+
+    private:
+
+        Source & m_source;
+
+        Scheduler & m_scheduler;
+
+        uint32_t m_periodUsec;
+        uint32_t m_deadlineUsec;
+        uint32_t m_signalTimeoutUsec;
+
+        std::atomic<bool>     m_running;
+        std::atomic<uint32_t> m_signalUsec;
+
+        PAA3905_Mailbox<record_t> m_records;
+        PAA3905_Mailbox<stats_t>  m_stats;
+
+        stats_t m_lastStats = {};  // consumer side
+
+        static void task(void * arg)
+        {
+            ((PAA3905_Acquisition *)arg)->run();
+        }
+
+        void run(void)
+        {
+            stats_t stats = {};
+            int64_t jitterSum = 0;
+            uint32_t jitterCount = 0;
+            record_t record = {};
+
+            if (m_periodUsec) {
+                m_scheduler.startPeriodic(m_periodUsec);
+            }
+
+            while (m_running) {
+
+                uint64_t release = 0;
+                bool timedOut = false;
+
+                if (m_periodUsec) {
+                    release = m_scheduler.waitForRelease();
+                }
+                else {
+                    timedOut = !m_scheduler.waitForSignal(m_signalTimeoutUsec);
+                }
+
+                if (!m_running) {
+                    break;
+                }
+
+                const uint64_t wakeup = m_scheduler.nowUsec();
+
+                if (timedOut) {
+                    release = wakeup;
+                    stats.timeouts++;
+                }
+                else if (!m_periodUsec) {
+                    // Unsigned subtraction handles wraparound of the 32-bit stamp
+                    release = wakeup - (uint32_t)((uint32_t)wakeup -
+                            m_signalUsec.load(std::memory_order_relaxed));
+                }
+
+                if (m_source.acquire(record.sample)) {
+                    record.usec = wakeup;
+                    if (!m_records.publish(record)) {
+                        stats.dropped++;
+                    }
+                    record.sequence++;
+                    stats.published++;
+                }
+
+                const uint64_t finish = m_scheduler.nowUsec();
+                const uint32_t elapsed = finish - wakeup;
+
+                stats.cycles++;
+                stats.acquireMaxUsec = max(stats.acquireMaxUsec, elapsed);
+
+                // A timeout has no release to be late for
+                if (!timedOut) {
+                    const int32_t jitter = (int32_t)(wakeup - release);
+                    stats.jitterLastUsec = jitter;
+                    stats.jitterMinUsec = jitterCount ?
+                        min(stats.jitterMinUsec, jitter) : jitter;
+                    stats.jitterMaxUsec = jitterCount ?
+                        max(stats.jitterMaxUsec, jitter) : jitter;
+                    jitterSum += jitter;
+                    jitterCount++;
+                    stats.jitterMeanUsec = (float)jitterSum / jitterCount;
+                }
+
+                if (finish > release + m_deadlineUsec) {
+                    stats.deadlineMisses++;
+                }
+
+                m_stats.publish(stats);
+            }
+        }
+
+        static int32_t min(const int32_t a, const int32_t b)
+        {
+            return a < b ? a : b;
+        }
+
+        static int32_t max(const int32_t a, const int32_t b)
+        {
+            return a > b ? a : b;
+        }
+
+        static uint32_t max(const uint32_t a, const uint32_t b)
+        {
+            return a > b ? a : b;
+        }
+
+}; // class PAA3905_Acquisition
+
+#if defined(ARDUINO)
+
+// Note that the acquisition task owns the SPI bus while it runs; do not
+// access the sensor from loop() at the same time.
+
+class PAA3905_MotionSource {
+
+    public:
+
+        typedef struct {
+            int16_t  deltaX;
+            int16_t  deltaY;
+            uint8_t  surfaceQuality;
+            uint32_t shutter;
+            PAA3905::lightMode_t lightMode;
+            bool     challengingSurface;
+        } sample_t;
+
+        PAA3905_MotionSource(PAA3905_MotionCapture & sensor)
+            : m_sensor(sensor)
+        {
+        }
+
+        bool acquire(sample_t & sample)
+        {
+            m_sensor.readBurstMode();
+
+            if (!m_sensor.motionDataAvailable()) {
+                return false;
+            }
+
+            sample.deltaX = m_sensor.getDeltaX();
+            sample.deltaY = m_sensor.getDeltaY();
+            sample.surfaceQuality = m_sensor.getSurfaceQuality();
+            sample.shutter = m_sensor.getShutter();
+            sample.lightMode = m_sensor.getLightMode();
+            sample.challengingSurface = m_sensor.challengingSurfaceDetected();
+
+            return true;
+        }
+
+    private:
+
+        PAA3905_MotionCapture & m_sensor;
+
+}; // class PAA3905_MotionSource
+
+class PAA3905_FrameSource {
+
+    public:
+
+        typedef struct {
+            uint8_t pixels[1225];
+        } sample_t;
+
+        PAA3905_FrameSource(PAA3905_FrameCapture & sensor)
+            : m_sensor(sensor)
+        {
+        }
+
+        bool acquire(sample_t & sample)
+        {
+            m_sensor.captureFrame(sample.pixels);
+            return true;
+        }
+
+    private:
+
+        PAA3905_FrameCapture & m_sensor;
+
+}; // class PAA3905_FrameSource
+
+#endif
@@ -0,0 +1,159 @@
+/* PAA3905 frame calibration: per-pixel dark-frame offset and flat-field gain,
+ * plus an orientation index map, all applied by
+ * PAA3905_FrameCapture::captureFrame() as each pixel is read.
+ *
+ * Copyright (c) 2021 Tlera Corporation and Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include "PAA3905.hpp"
+
+class PAA3905_Calibration {
+
+    public:
+
+        static const uint8_t  SIZE   = 35;
+        static const uint16_t PIXELS = SIZE * SIZE;
+
+        // orientation is a combination of PAA3905::ORIENTATION_* bits
+        PAA3905_Calibration(const uint8_t orientation = PAA3905::ORIENTATION_NORMAL)
+        {
+            reset();
+            setOrientation(orientation);
+        }
+
+        // Unity gain, zero offset
+        void reset(void)
+        {
+            for (uint16_t i = 0; i < PIXELS; ++i) {
+                m_offset[i] = 0;
+                m_gain[i] = UNITY_GAIN;
+            }
+        }
+
+        // Inversions are applied first, then the swap
+        void setOrientation(const uint8_t orientation)
+        {
+            for (uint8_t j = 0; j < SIZE; ++j) {
+
+                for (uint8_t k = 0; k < SIZE; ++k) {
+
+                    uint8_t row = (orientation & PAA3905::ORIENTATION_YINVERT) ?
+                        SIZE - 1 - j : j;
+
+                    uint8_t col = (orientation & PAA3905::ORIENTATION_XINVERT) ?
+                        SIZE - 1 - k : k;
+
+                    if (orientation & PAA3905::ORIENTATION_SWAP) {
+                        const uint8_t tmp = row;
+                        row = col;
+                        col = tmp;
+                    }
+
+                    m_index[j*SIZE + k] = row*SIZE + col;
+                }
+            }
+        }
+
+        // Destination in the output frame of the i'th pixel read out
+        uint16_t index(const uint16_t i) const
+        {
+            return m_index[i];
+        }
+
+        uint8_t correct(const uint16_t i, const uint8_t raw) const
+        {
+            const int32_t value =
+                ((int32_t)(raw - m_offset[i]) * m_gain[i] + UNITY_GAIN/2) >> GAIN_BITS;
+
+            return value < 0 ? 0 : value > 255 ? 255 : value;
+        }
+
+        // Calibration frames are summed, in sensor order, into the gain table,
+        // so capture dark frames before flat frames.  Use 1 to 255 frames; a
+        // count of zero leaves the tables untouched.
+
+        void beginFrames(void)
+        {
+            for (uint16_t i = 0; i < PIXELS; ++i) {
+                m_gain[i] = 0;
+            }
+        }
+
+        void addFrame(const uint8_t * frame)
+        {
+            for (uint16_t i = 0; i < PIXELS; ++i) {
+                m_gain[i] += frame[i];
+            }
+        }
+
+        // Frames were taken with the lens covered
+        void endDarkFrames(const uint8_t count)
+        {
+            if (count == 0) {
+                return;
+            }
+
+            for (uint16_t i = 0; i < PIXELS; ++i) {
+                m_offset[i] = (m_gain[i] + count/2) / count;
+                m_gain[i] = UNITY_GAIN;
+            }
+        }
+
+        // Frames were taken of a uniformly lit, featureless target
+        void endFlatFrames(const uint8_t count)
+        {
+            if (count == 0) {
+                return;
+            }
+
+            uint32_t total = 0;
+            uint16_t responsive = 0;
+
+            for (uint16_t i = 0; i < PIXELS; ++i) {
+                const int32_t response = m_gain[i] - (int32_t)m_offset[i] * count;
+                if (response > 0) {
+                    total += response;
+                    responsive++;
+                }
+            }
+
+            if (responsive == 0) {
+                for (uint16_t i = 0; i < PIXELS; ++i) {
+                    m_gain[i] = UNITY_GAIN;
+                }
+                return;
+            }
+
+            for (uint16_t i = 0; i < PIXELS; ++i) {
+
+                const int32_t response = m_gain[i] - (int32_t)m_offset[i] * count;
+
+                if (response <= 0) {
+                    m_gain[i] = UNITY_GAIN;
+                    continue;
+                }
+
+                // Scale each pixel's response up or down to the frame mean
+                const uint32_t gain =
+                    ((uint64_t)total * UNITY_GAIN / responsive + response/2) / response;
+
+                m_gain[i] = gain > 0xFFFF ? 0xFFFF : gain;
+            }
+        }
+
+    private:
+
+        static const uint8_t  GAIN_BITS  = 8;
+        static const uint16_t UNITY_GAIN = 1 << GAIN_BITS;
+
+        uint8_t  m_offset[PIXELS];
+        uint16_t m_gain[PIXELS];    // Q8.8 fixed point
+        uint16_t m_index[PIXELS];
+
+}; // class PAA3905_Calibration
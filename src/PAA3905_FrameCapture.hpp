@@ -11,6 +11,7 @@
 #include <SPI.h>
 
 #include "PAA3905.hpp"
+#include "PAA3905_Calibration.hpp"
 
 class PAA3905_FrameCapture : public PAA3905 {
 
@@ -34,27 +35,7 @@ class PAA3905_FrameCapture : public PAA3905 {
 
         void captureFrame(uint8_t * frameArray)
         {  
-            // make sure not in superlowlight mode for frame capture
-            setMode(DETECTION_STANDARD, AUTO_MODE_01); 
-
-            writeByteDelay(0x7F, 0x00);
-            writeByteDelay(0x67, 0x25);
-            writeByteDelay(0x55, 0x20);
-            writeByteDelay(0x7F, 0x13);
-            writeByteDelay(0x42, 0x01);
-            writeByteDelay(0x7F, 0x00);
-            writeByteDelay(0x0F, 0x11);
-            writeByteDelay(0x0F, 0x13);
-            writeByteDelay(0x0F, 0x11);
-
-            uint8_t tempStatus = 0;
-
-            // wait for grab status bit 0 to equal 1
-            while( !(tempStatus & 0x01) ) {
-                tempStatus = readByte(RAWDATA_GRAB_STATUS); 
-            } 
-
-            writeByteDelay(RAWDATA_GRAB, 0xFF); // start frame capture mode
+            startFrameCapture();
 
             for (uint8_t j = 0; j < 35; j++) {
 
@@ -66,6 +47,37 @@ class PAA3905_FrameCapture : public PAA3905 {
             }
         }
 
+        // Corrects and reorients each pixel as it is read, so no second pass
+        // or buffer is needed
+        void captureFrame(
+                uint8_t * frameArray, const PAA3905_Calibration & calibration)
+        {  
+            startFrameCapture();
+
+            for (uint16_t i = 0; i < 1225; i++) {
+
+                frameArray[calibration.index(i)] =
+                    calibration.correct(i, readByte(RAWDATA_GRAB)); 
+            }
+        }
+
+        // Capture with the lens covered
+        void captureDarkFrames(
+                PAA3905_Calibration & calibration, const uint8_t count)
+        {
+            captureCalibrationFrames(calibration, count);
+            calibration.endDarkFrames(count);
+        }
+
+        // Capture with the sensor viewing a uniformly lit, featureless target,
+        // after captureDarkFrames()
+        void captureFlatFrames(
+                PAA3905_Calibration & calibration, const uint8_t count)
+        {
+            captureCalibrationFrames(calibration, count);
+            calibration.endFlatFrames(count);
+        }
+
     protected:
 
        virtual void initMode(void) override 
@@ -84,4 +96,46 @@ class PAA3905_FrameCapture : public PAA3905 {
            RAWDATA_GRAB          = 0x13
        };
 
+       void startFrameCapture(void)
+       {
+            // make sure not in superlowlight mode for frame capture
+            setMode(DETECTION_STANDARD, AUTO_MODE_01); 
+
+            writeByteDelay(0x7F, 0x00);
+            writeByteDelay(0x67, 0x25);
+            writeByteDelay(0x55, 0x20);
+            writeByteDelay(0x7F, 0x13);
+            writeByteDelay(0x42, 0x01);
+            writeByteDelay(0x7F, 0x00);
+            writeByteDelay(0x0F, 0x11);
+            writeByteDelay(0x0F, 0x13);
+            writeByteDelay(0x0F, 0x11);
+
+            uint8_t tempStatus = 0;
+
+            // wait for grab status bit 0 to equal 1
+            while( !(tempStatus & 0x01) ) {
+                tempStatus = readByte(RAWDATA_GRAB_STATUS); 
+            } 
+
+            writeByteDelay(RAWDATA_GRAB, 0xFF); // start frame capture mode
+       }
+
+       void captureCalibrationFrames(
+               PAA3905_Calibration & calibration, const uint8_t count)
+       {
+           if (count == 0) {
+               return;
+           }
+
+           uint8_t frameArray[1225];
+
+           calibration.beginFrames();
+
+           for (uint8_t n = 0; n < count; n++) {
+               captureFrame(frameArray);
+               calibration.addFrame(frameArray);
+           }
+       }
+
 }; // class PAA3905_FrameCapture
@@ -0,0 +1,606 @@
+/* PAA3905 frame-stream processing pipeline (host only)
+ *
+ * Turns the noisy 35x35 frames from PAA3905_FrameCapture into a cleaner,
+ * higher-resolution stream in three stages:
+ *
+ *   1. Registration: the displacement of each frame relative to the one
+ *      before it, either supplied by the caller (e.g. from the sensor's motion
+ *      deltas, converted to pixels) or estimated by block matching.
+ *
+ *   2. Temporal denoise: a motion-adaptive recursive filter whose state is
+ *      shifted by the registration before each update.
+ *
+ *   3. Super-resolution: shift-and-add fusion of the last few denoised
+ *      frames onto a grid SCALE times finer.  For a given frame and output
+ *      phase the sub-pixel offset is the same everywhere, so each phase plane
+ *      is just a weighted sum of whole shifted frames.
+ *
+ * Rows are split across a small pool of worker threads and the inner row
+ * kernels use SSE2 when available.
+ *
+ * Copyright (c) 2021 Tlera Corporation and Simon D. Levy
+ *
+ * MIT License
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+class PAA3905_FramePipeline {
+
+    public:
+
+        static const uint8_t  SIZE       = 35;
+        static const uint16_t PIXELS     = SIZE * SIZE;
+        static const uint8_t  MAX_SCALE  = 4;
+        static const uint8_t  MAX_WINDOW = 8;
+
+        // Nominal lens field of view, from the PAA3905E1 datasheet
+        static constexpr float FOV_DEGREES = 42;
+
+        // threads = 0 uses every hardware thread; 1 runs everything inline
+        PAA3905_FramePipeline(
+                const uint8_t scale,
+                const uint8_t window = 4,
+                const float denoiseGain = 0.5f,
+                const uint8_t motionThreshold = 24,
+                unsigned threads = 0)
+        {
+            m_scale = scale < 1 ? 1 : scale > MAX_SCALE ? MAX_SCALE : scale;
+            m_window = window < 1 ? 1 : window > MAX_WINDOW ? MAX_WINDOW : window;
+            m_denoiseGain = denoiseGain;
+            m_motionThreshold = motionThreshold;
+
+            m_slots.resize((m_window + 1) * SLOT_PIXELS);
+            m_slotX.resize(m_window + 1);
+            m_slotY.resize(m_window + 1);
+
+            reset();
+
+            if (threads == 0) {
+                threads = std::thread::hardware_concurrency();
+            }
+
+            m_stage = STAGE_NONE;
+            m_generation = 0;
+            m_busy = 0;
+            m_nworkers = threads > 1 ? threads : 1;
+
+            for (unsigned k = 1; k < m_nworkers; ++k) {
+                m_workers.push_back(std::thread(&PAA3905_FramePipeline::work, this, k));
+            }
+        }
+
+        ~PAA3905_FramePipeline(void)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_stage = STAGE_EXIT;
+                m_generation++;
+            }
+            m_wake.notify_all();
+
+            for (size_t k = 0; k < m_workers.size(); ++k) {
+                m_workers[k].join();
+            }
+        }
+
+        uint16_t outputSize(void) const
+        {
+            return SIZE * m_scale;
+        }
+
+        // Forget all history; the next frame starts a new sequence
+        void reset(void)
+        {
+            m_count = 0;
+            m_newest = 0;
+            m_x = 0;
+            m_y = 0;
+            m_dx = 0;
+            m_dy = 0;
+            m_residualX = 0;
+            m_residualY = 0;
+        }
+
+        // Image motion in pixels per motion count, given the CPI per meter of
+        // height reported by PAA3905::getResolution().  Height cancels out:
+        // at height h the sensor reports cpiPerMeter / h counts per inch of
+        // travel, and an inch of travel sweeps 0.0254 / h radians of view.
+        static float pixelsPerCount(const float cpiPerMeter,
+                const float fovDegrees = FOV_DEGREES)
+        {
+            const float radiansPerPixel = fovDegrees * 3.14159265f / 180 / SIZE;
+
+            return 0.0254f / (cpiPerMeter * radiansPerPixel);
+        }
+
+        // Converts deltas summed from PAA3905_MotionCapture::getDeltaX/Y()
+        // over one frame interval into the (dx, dy) that process() expects.
+        // The sensor reports its own motion over the surface, so the image
+        // moves the opposite way.  This assumes the frames are in the same
+        // orientation as the motion deltas: raw frames are always in sensor
+        // order, so pass the sensor's orientation to a PAA3905_Calibration
+        // and capture through it.  Check the sign and scale on your mounting
+        // against the estimator (process() without deltas, then getShift());
+        // a negative pixelsPerCount flips the sign.
+        static void motionToPixels(const int16_t deltaX, const int16_t deltaY,
+                const float pixelsPerCount, float & dx, float & dy)
+        {
+            dx = -deltaX * pixelsPerCount;
+            dy = -deltaY * pixelsPerCount;
+        }
+
+        // (dx, dy) is how far the scene moved in the image since the previous
+        // frame, in pixels, with +x along a frame row and +y down the rows
+        // (see motionToPixels()).  output must hold outputSize()^2 bytes.
+        void process(const uint8_t * frame, const float dx, const float dy,
+                uint8_t * output)
+        {
+            const uint8_t previous = m_newest;
+
+            m_newest = (m_newest + 1) % (m_window + 1);
+            m_frame = frame;
+
+            // Keep the estimator's reference current whichever overload is used
+            memcpy(m_lastRaw, frame, PIXELS);
+
+            m_dx = dx;
+            m_dy = dy;
+            m_x += dx;
+            m_y += dy;
+            m_slotX[m_newest] = m_x;
+            m_slotY[m_newest] = m_y;
+
+            // Shift the filter state by whole pixels, carrying the remainder
+            // so that the state does not drift off the frame grid over time
+            m_shiftX = (int)floorf(dx + m_residualX + 0.5f);
+            m_shiftY = (int)floorf(dy + m_residualY + 0.5f);
+            m_residualX += dx - m_shiftX;
+            m_residualY += dy - m_shiftY;
+
+            if (m_count == 0 || abs(m_shiftX) > PAD || abs(m_shiftY) > PAD) {
+                m_state = NULL;
+                m_residualX = 0;
+                m_residualY = 0;
+            }
+            else {
+                m_state = slot(previous);
+            }
+
+            run(STAGE_DENOISE);
+            padRows(slot(m_newest));
+
+            if (m_count < m_window) {
+                m_count++;
+            }
+
+            planFusion();
+
+            m_output = output;
+            run(STAGE_FUSE);
+        }
+
+        // Displacement used for the most recent frame, supplied or estimated
+        void getShift(float & dx, float & dy) const
+        {
+            dx = m_dx;
+            dy = m_dy;
+        }
+
+        // Same as above, estimating the displacement from the frames alone
+        void process(const uint8_t * frame, uint8_t * output)
+        {
+            float dx = 0, dy = 0;
+
+            if (m_count > 0) {
+                estimateShift(frame, dx, dy);
+            }
+
+            process(frame, dx, dy, output);
+        }
+
+    private:
+
+        static const int PAD         = 8;
+        static const int STRIDE      = SIZE + 2 * PAD;
+        static const int SLOT_PIXELS = STRIDE * STRIDE;
+        static const int SEARCH      = 3;
+
+        typedef enum {
+            STAGE_NONE,
+            STAGE_DENOISE,
+            STAGE_FUSE,
+            STAGE_EXIT
+        } stage_t;
+
+        // One contribution to one output phase plane
+        typedef struct {
+            const float * source;
+            float weight;
+        } term_t;
+
+        uint8_t m_scale;
+        uint8_t m_window;
+        float   m_denoiseGain;
+        uint8_t m_motionThreshold;
+
+        // Ring of padded, denoised frames (one spare for the filter state)
+        std::vector<float> m_slots;
+        std::vector<float> m_slotX;
+        std::vector<float> m_slotY;
+
+        uint8_t m_count;
+        uint8_t m_newest;
+
+        float m_x, m_y;
+        float m_dx, m_dy;
+        float m_residualX, m_residualY;
+        int   m_shiftX, m_shiftY;
+
+        uint8_t m_lastRaw[PIXELS];
+
+        // Per-frame work description read by the workers
+        const uint8_t * m_frame;
+        const float *   m_state;
+        uint8_t *       m_output;
+        term_t          m_terms[MAX_SCALE * MAX_SCALE][MAX_WINDOW];
+        uint8_t         m_nterms[MAX_SCALE * MAX_SCALE];
+        float           m_norms[MAX_SCALE * MAX_SCALE];
+
+        // Worker pool
+        std::vector<std::thread> m_workers;
+        std::mutex               m_mutex;
+        std::condition_variable  m_wake;
+        std::condition_variable  m_done;
+        stage_t                  m_stage;
+        uint32_t                 m_generation;
+        unsigned                 m_busy;
+        unsigned                 m_nworkers;
+
+        float * slot(const uint8_t index)
+        {
+            return &m_slots[index * SLOT_PIXELS];
+        }
+
+        // Interior pixel (0,0) of a padded slot
+        static const float * origin(const float * padded)
+        {
+            return padded + PAD * STRIDE + PAD;
+        }
+
+        void run(const stage_t stage)
+        {
+            if (m_nworkers == 1) {
+                doStage(stage, 0, SIZE);
+                return;
+            }
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            m_stage = stage;
+            m_busy = m_nworkers - 1;
+            m_generation++;
+            m_wake.notify_all();
+
+            lock.unlock();
+            doStage(stage, 0, SIZE / m_nworkers);
+            lock.lock();
+
+            m_done.wait(lock, [this] { return m_busy == 0; });
+        }
+
+        void work(const unsigned id)
+        {
+            uint32_t seen = 0;
+
+            while (true) {
+
+                stage_t stage;
+
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_wake.wait(lock, [&] { return m_generation != seen; });
+                    seen = m_generation;
+                    stage = m_stage;
+                }
+
+                if (stage == STAGE_EXIT) {
+                    return;
+                }
+
+                doStage(stage,
+                        id * SIZE / m_nworkers, (id + 1) * SIZE / m_nworkers);
+
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_busy--;
+                }
+                m_done.notify_one();
+            }
+        }
+
+        void doStage(const stage_t stage, const int row0, const int row1)
+        {
+            for (int row = row0; row < row1; ++row) {
+                switch (stage) {
+                    case STAGE_DENOISE:
+                        denoiseRow(row);
+                        break;
+                    case STAGE_FUSE:
+                        fuseRow(row);
+                        break;
+                    default:
+                        break;
+                }
+            }
+        }
+
+        void denoiseRow(const int row)
+        {
+            float * dst = slot(m_newest) + (PAD + row) * STRIDE;
+            const uint8_t * src = m_frame + row * SIZE;
+
+            if (m_state) {
+                const float * prev =
+                    origin(m_state) + (row - m_shiftY) * STRIDE - m_shiftX;
+                denoiseKernel(dst + PAD, prev, src,
+                        m_denoiseGain, m_motionThreshold);
+            }
+            else {
+                for (int k = 0; k < SIZE; ++k) {
+                    dst[PAD + k] = src[k];
+                }
+            }
+
+            for (int k = 0; k < PAD; ++k) {
+                dst[k] = dst[PAD];
+                dst[PAD + SIZE + k] = dst[PAD + SIZE - 1];
+            }
+        }
+
+        static void padRows(float * padded)
+        {
+            for (int k = 0; k < PAD; ++k) {
+                memcpy(padded + k * STRIDE,
+                        padded + PAD * STRIDE, STRIDE * sizeof(float));
+                memcpy(padded + (PAD + SIZE + k) * STRIDE,
+                        padded + (PAD + SIZE - 1) * STRIDE, STRIDE * sizeof(float));
+            }
+        }
+
+        // Gaussian weights, sigma of half an output pixel
+        static float fusionWeight(const float du, const float dv)
+        {
+            return expf(-2.0f * (du * du + dv * dv));
+        }
+
+        void planFusion(void)
+        {
+            const float nx = m_slotX[m_newest];
+            const float ny = m_slotY[m_newest];
+
+            for (uint8_t py = 0; py < m_scale; ++py) {
+
+                for (uint8_t px = 0; px < m_scale; ++px) {
+
+                    const uint8_t phase = py * m_scale + px;
+                    float total = 0;
+
+                    m_nterms[phase] = 0;
+
+                    for (uint8_t k = 0; k < m_count; ++k) {
+
+                        const uint8_t index =
+                            (m_newest + m_window + 1 - k) % (m_window + 1);
+
+                        // Where this output pixel falls in frame k
+                        const float cx = (px + 0.5f) / m_scale - 0.5f -
+                            (nx - m_slotX[index]);
+                        const float cy = (py + 0.5f) / m_scale - 0.5f -
+                            (ny - m_slotY[index]);
+
+                        const int ox = (int)floorf(cx + 0.5f);
+                        const int oy = (int)floorf(cy + 0.5f);
+
+                        if (abs(ox) > PAD || abs(oy) > PAD) {
+                            continue;
+                        }
+
+                        const float weight = fusionWeight(
+                                (cx - ox) * m_scale, (cy - oy) * m_scale);
+
+                        term_t & term = m_terms[phase][m_nterms[phase]++];
+                        term.source = origin(slot(index)) + oy * STRIDE + ox;
+                        term.weight = weight;
+                        total += weight;
+                    }
+
+                    m_norms[phase] = 1.0f / total;
+                }
+            }
+        }
+
+        void fuseRow(const int row)
+        {
+            float acc[SIZE + 3];
+
+            const uint16_t width = outputSize();
+
+            for (uint8_t py = 0; py < m_scale; ++py) {
+
+                uint8_t * dst = m_output + (row * m_scale + py) * width;
+
+                for (uint8_t px = 0; px < m_scale; ++px) {
+
+                    const uint8_t phase = py * m_scale + px;
+
+                    memset(acc, 0, sizeof(acc));
+
+                    for (uint8_t k = 0; k < m_nterms[phase]; ++k) {
+                        const term_t & term = m_terms[phase][k];
+                        axpyKernel(acc, term.source + row * STRIDE, term.weight);
+                    }
+
+                    const float norm = m_norms[phase];
+
+                    for (int k = 0; k < SIZE; ++k) {
+                        const float value = acc[k] * norm + 0.5f;
+                        dst[k * m_scale + px] =
+                            value <= 0 ? 0 : value >= 255 ? 255 : (uint8_t)value;
+                    }
+                }
+            }
+        }
+
+        // Minimizes mean absolute difference over integer shifts, then refines
+        // each axis with a parabola through the neighbouring costs
+        void estimateShift(const uint8_t * frame, float & dx, float & dy)
+        {
+            static const int SPAN = 2 * SEARCH + 1;
+
+            float cost[SPAN * SPAN];
+
+            int bestX = 0, bestY = 0;
+            uint32_t bestCost = UINT32_MAX;
+
+            for (int sy = -SEARCH; sy <= SEARCH; ++sy) {
+
+                for (int sx = -SEARCH; sx <= SEARCH; ++sx) {
+
+                    uint32_t sum = 0;
+
+                    for (int j = SEARCH; j < SIZE - SEARCH; ++j) {
+                        const uint8_t * a = frame + j * SIZE + SEARCH;
+                        const uint8_t * b = m_lastRaw + (j - sy) * SIZE + SEARCH - sx;
+                        sum += sadKernel(a, b, SIZE - 2 * SEARCH);
+                    }
+
+                    cost[(sy + SEARCH) * SPAN + sx + SEARCH] = (float)sum;
+
+                    if (sum < bestCost) {
+                        bestCost = sum;
+                        bestX = sx;
+                        bestY = sy;
+                    }
+                }
+            }
+
+            const float * best = &cost[(bestY + SEARCH) * SPAN + bestX + SEARCH];
+
+            dx = bestX + refine(bestX, best, 1);
+            dy = bestY + refine(bestY, best, SPAN);
+        }
+
+        // best points at the minimum cost; its neighbours along the axis are
+        // stride apart, and only exist when best is inside the search window
+        static float refine(const int offset, const float * best, const int stride)
+        {
+            if (offset == -SEARCH || offset == SEARCH) {
+                return 0;
+            }
+
+            const float lo = best[-stride];
+            const float mid = best[0];
+            const float hi = best[stride];
+
+            const float curvature = lo - 2 * mid + hi;
+
+            return curvature > 0 ? 0.5f * (lo - hi) / curvature : 0;
+        }
+
+        // ---- Row kernels --------------------------------------------------
+
+        // dst = prev + k * (src - prev), k = 1 where the change exceeds the
+        // motion threshold (so moving edges are not smeared)
+        static void denoiseKernel(float * dst, const float * prev,
+                const uint8_t * src, const float gain, const float threshold)
+        {
+            int k = 0;
+
+#if defined(__SSE2__)
+            const __m128  vgain = _mm_set1_ps(gain);
+            const __m128  vthresh = _mm_set1_ps(threshold);
+            const __m128  vones = _mm_set1_ps(1.0f);
+            const __m128  vabs = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+            const __m128i vzero = _mm_setzero_si128();
+
+            for (; k + 4 <= SIZE; k += 4) {
+                int32_t bytes;
+                memcpy(&bytes, src + k, 4);
+                __m128i wide = _mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), vzero);
+                wide = _mm_unpacklo_epi16(wide, vzero);
+
+                const __m128 x = _mm_cvtepi32_ps(wide);
+                const __m128 p = _mm_loadu_ps(prev + k);
+                const __m128 diff = _mm_sub_ps(x, p);
+                const __m128 moving =
+                    _mm_cmpgt_ps(_mm_and_ps(diff, vabs), vthresh);
+                const __m128 gains = _mm_or_ps(
+                        _mm_and_ps(moving, vones), _mm_andnot_ps(moving, vgain));
+
+                _mm_storeu_ps(dst + k, _mm_add_ps(p, _mm_mul_ps(gains, diff)));
+            }
+#endif
+
+            for (; k < SIZE; ++k) {
+                const float diff = src[k] - prev[k];
+                dst[k] = prev[k] + (fabsf(diff) > threshold ? 1 : gain) * diff;
+            }
+        }
+
+        static void axpyKernel(float * acc, const float * src, const float weight)
+        {
+            int k = 0;
+
+#if defined(__SSE2__)
+            const __m128 w = _mm_set1_ps(weight);
+
+            for (; k + 4 <= SIZE; k += 4) {
+                _mm_storeu_ps(acc + k, _mm_add_ps(_mm_loadu_ps(acc + k),
+                            _mm_mul_ps(w, _mm_loadu_ps(src + k))));
+            }
+#endif
+
+            for (; k < SIZE; ++k) {
+                acc[k] += weight * src[k];
+            }
+        }
+
+        static uint32_t sadKernel(const uint8_t * a, const uint8_t * b,
+                const int count)
+        {
+            uint32_t sum = 0;
+            int k = 0;
+
+#if defined(__SSE2__)
+            for (; k + 16 <= count; k += 16) {
+                const __m128i sad = _mm_sad_epu8(
+                        _mm_loadu_si128((const __m128i *)(a + k)),
+                        _mm_loadu_si128((const __m128i *)(b + k)));
+                sum += _mm_cvtsi128_si32(sad) +
+                    _mm_cvtsi128_si32(_mm_srli_si128(sad, 8));
+            }
+#endif
+
+            for (; k < count; ++k) {
+                sum += a[k] > b[k] ? a[k] - b[k] : b[k] - a[k];
+            }
+
+            return sum;
+        }
+
+}; // class PAA3905_FramePipeline